@@ -0,0 +1,196 @@
+/* 
+ * Replaceable global operator new/delete, including the sized and aligned
+ * overloads, and the std::pmr::memory_resource declared in malloclab_cxx.h,
+ * all built on malloclab_mm.c. Needs C++17; link it together with
+ * malloclab_mm.c.
+ * 
+ * Everything goes through mm_memalign and mm_free_sized. The sizes known
+ * to sized delete and to do_deallocate are passed along, but freeing
+ * still reads the block header, so there is no faster sized path.
+ * 
+ * The allocator itself has no locking, so all the calls made from here
+ * are serialized by heap_lock. That does not cover malloc and free called
+ * directly from C at the same time, which must not run concurrently.
+ */
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+#include "malloclab_cxx.h"
+
+/* Serializes every use of the heap from C++ */
+static std::mutex heap_lock;
+
+static void *cxx_alloc(std::size_t size, std::size_t alignment) noexcept
+{
+    std::lock_guard<std::mutex> guard(heap_lock);
+    return mm_memalign(alignment, size);
+}
+
+static void cxx_delete(void *p, std::size_t size) noexcept
+{
+    if (p == nullptr)
+        return;
+    std::lock_guard<std::mutex> guard(heap_lock);
+    mm_free_sized(p, size);
+}
+
+/* 
+ * cxx_new - Allocate as operator new does: retry after calling the
+ *           new_handler, and throw bad_alloc if there is none.
+ */
+static void *cxx_new(std::size_t size, std::size_t alignment)
+{
+    void *p;
+
+    if (size == 0)
+        size = 1;   /* Each new must return a distinct pointer */
+    while ((p = cxx_alloc(size, alignment)) == nullptr)
+    {
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+    return p;
+}
+
+static void *cxx_new_nothrow(std::size_t size, std::size_t alignment) noexcept
+{
+    try
+    {
+        return cxx_new(size, alignment);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+#define DEFAULT_ALIGN  __STDCPP_DEFAULT_NEW_ALIGNMENT__
+
+void *operator new(std::size_t size)
+{
+    return cxx_new(size, DEFAULT_ALIGN);
+}
+
+void *operator new[](std::size_t size)
+{
+    return cxx_new(size, DEFAULT_ALIGN);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return cxx_new_nothrow(size, DEFAULT_ALIGN);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return cxx_new_nothrow(size, DEFAULT_ALIGN);
+}
+
+void *operator new(std::size_t size, std::align_val_t al)
+{
+    return cxx_new(size, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t size, std::align_val_t al)
+{
+    return cxx_new(size, static_cast<std::size_t>(al));
+}
+
+void *operator new(std::size_t size, std::align_val_t al,
+                   const std::nothrow_t &) noexcept
+{
+    return cxx_new_nothrow(size, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t size, std::align_val_t al,
+                     const std::nothrow_t &) noexcept
+{
+    return cxx_new_nothrow(size, static_cast<std::size_t>(al));
+}
+
+void operator delete(void *p) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete[](void *p) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete(void *p, std::size_t size) noexcept
+{
+    cxx_delete(p, size);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept
+{
+    cxx_delete(p, size);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete(void *p, std::align_val_t,
+                     const std::nothrow_t &) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete[](void *p, std::align_val_t,
+                       const std::nothrow_t &) noexcept
+{
+    cxx_delete(p, 0);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t) noexcept
+{
+    cxx_delete(p, size);
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t) noexcept
+{
+    cxx_delete(p, size);
+}
+
+void *mm_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    return cxx_new(bytes, alignment);
+}
+
+void mm_resource::do_deallocate(void *p, std::size_t bytes, std::size_t)
+{
+    cxx_delete(p, bytes);
+}
+
+bool mm_resource::do_is_equal(const std::pmr::memory_resource &other) const
+    noexcept
+{
+    return dynamic_cast<const mm_resource *>(&other) != nullptr;
+}
+
+mm_resource *mm_heap_resource() noexcept
+{
+    static mm_resource resource;
+    return &resource;
+}
@@ -0,0 +1,36 @@
+/* 
+ * C++ interface to the allocator in malloclab_mm.c. malloclab_cxx.cc
+ * replaces the global operator new/delete with it, and mm_resource lets
+ * std::pmr containers allocate from it explicitly.
+ * These C++ entry points are serialized by a lock in malloclab_cxx.cc, so
+ * they may be used from several threads. The allocator itself has no
+ * locking: malloc, free, realloc and calloc must not be called from C at
+ * the same time as them, nor from several threads at once.
+ */
+#ifndef MALLOCLAB_CXX_H
+#define MALLOCLAB_CXX_H
+
+#include "malloclab_mm.h"
+
+#ifdef __cplusplus
+#include <memory_resource>
+
+/* 
+ * mm_resource - A std::pmr::memory_resource on the heap of malloclab_mm.c.
+ * There is one heap per process, so all mm_resource objects are equal.
+ */
+class mm_resource : public std::pmr::memory_resource {
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override;
+};
+
+/* The shared mm_resource, e.g. for std::pmr::set_default_resource */
+mm_resource *mm_heap_resource() noexcept;
+
+#endif /* def __cplusplus */
+
+#endif /* MALLOCLAB_CXX_H */
@@ -1,8 +1,9 @@
 /* 
  * Simple, 32-bit and 64-bit clean allocator based on implicit free
  * lists, first-fit placement, and boundary tag coalescing, as described
- * in the CS:APP3e text. Blocks must be aligned to doubleword (8 byte) 
- * boundaries. Minimum block size is 16 bytes. 
+ * in the CS:APP3e text. Blocks must be aligned to ALIGNMENT bytes, which
+ * is 16 on 64-bit (as the x86-64 ABI expects) and 8 otherwise, and can be
+ * set with -DALIGNMENT=n. Minimum block size is MAX(16, ALIGNMENT) bytes. 
  * 
  * Finished by Sizhe Li, 1900013061
  * 
@@ -11,7 +12,7 @@
  * to organize the other lists. Here's a detail that the tail block doesn't
  * have a prev ptr.
  * We insert all the 11 tails into the prologue block, so the size of the
- * prologue equals to 24 words.
+ * prologue equals to 24 words, rounded up to ALIGNMENT.
  * 
  * We coalesce the free blocks at once. And we use the add and delete function
  * to manipulate the list.
@@ -25,13 +26,57 @@
  * In the first 9 list, we use first-fit search, while in the last 2 lists, we
  * use best-fit search.
  * 
+ * The free-list links (including the 11 tails in the prologue) are stored
+ * as offsets from the start of the heap rather than as raw pointers, so the
+ * heap does not depend on the address it is mapped at.
+ * When compiled with -DMM_PERSIST and the MM_HEAP_FILE environment variable
+ * names a file, mm_init maps the heap from that file instead of mem_sbrk.
+ * If the file holds a heap that was closed cleanly (mm_close, or normal
+ * process exit) and passes a consistency check, it is resumed as it is;
+ * otherwise a new heap is formatted in the file.
+ * The application finds its data in a resumed heap through the root set
+ * with mm_set_root. Links stored by the application are its own business:
+ * raw pointers only stay valid if the heap is mapped at the same address,
+ * which -DPERSIST_BASE=addr enforces.
+ * 
+ * When compiled with -DMM_TRACE and the MM_TRACE_FILE environment variable
+ * names a file, every malloc, free, realloc and calloc is recorded as a
+ * binary event (see malloclab_trace.h) into a per-thread ring buffer. A
+ * background thread writes the rings to the file, and malloclab_trace.c
+ * converts it to the malloclab trace format for replay.
+ * 
+ * To avoid growing the heap piece by piece at startup, mm_reserve grows it
+ * by a given amount in one step, and mm_prewarm splits new free blocks
+ * of the block sizes that mm_profile recorded in an earlier run.
+ * 
+ * mm_memalign and mm_free_sized are the entry points for the C++ operator
+ * new/delete and std::pmr::memory_resource in malloclab_cxx.cc.
+ * All the entry points beyond mm.h are declared in malloclab_mm.h.
+ * 
  */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#ifdef MM_PERSIST
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef MM_TRACE
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "malloclab_trace.h"
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "malloclab_mm.h"
 
 /* do not change the following! */
 #ifdef DRIVER
@@ -49,6 +94,30 @@
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
 
+/* Payload alignment (bytes), a power of 2 no smaller than DSIZE */
+#ifndef ALIGNMENT
+#if defined(__LP64__) || defined(_WIN64)
+#define ALIGNMENT   16
+#else
+#define ALIGNMENT   DSIZE
+#endif
+#endif
+#if (ALIGNMENT & (ALIGNMENT-1)) || ALIGNMENT < DSIZE
+#error "ALIGNMENT must be a power of 2 no smaller than DSIZE"
+#endif
+
+/* Round size up to a multiple of ALIGNMENT */
+#define ALIGN(size)    (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+
+/* Minimum block size: header, next ptr and footer, kept aligned */
+#define MINBLOCK       MAX(2*DSIZE, ALIGNMENT)
+
+/* Largest block size a header can hold */
+#define MAXBLOCK       ((size_t)(~0x7u) & ~(size_t)(ALIGNMENT-1))
+
+/* Prologue size: header, the 11 list tails and footer, kept aligned */
+#define PROLOGUE_SIZE  ALIGN(12*DSIZE)
+
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) 
 
@@ -68,16 +137,26 @@
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))) 
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))) 
 
+/* Convert between a ptr in the heap and its offset from heap_base.
+ * Offset 0 is the alignment padding, so it is used to store NULL */
+#define PTR2OFF(p)     ((p) ? (size_t)((char *)(p) - heap_base) : 0)
+#define OFF2PTR(off)   ((off) ? heap_base + (off) : (char *)0)
+
 /* Given a ptr to find the previous/next block in the free block */
-#define GET_PRED_PTR(bp)    (*(char**)((bp) + DSIZE))
-#define GET_NEXT_PTR(bp)    (*(char**)(bp))
+#define GET_PRED_PTR(bp)    OFF2PTR(*(size_t *)((char *)(bp) + DSIZE))
+#define GET_NEXT_PTR(bp)    OFF2PTR(*(size_t *)(bp))
+
+/* Check whether the free block is the last one, from the raw offset */
+#define NEXT_IS_NULL(bp)    (*(size_t *)(bp) == 0)
 
 /* Set the previous/next block in the free block */
-#define PUT_PRED_PTR(bp, newptr)   (GET_PRED_PTR(bp) = newptr)
-#define PUT_NEXT_PTR(bp, newptr)   (GET_NEXT_PTR(bp) = newptr)
+#define PUT_PRED_PTR(bp, newptr)   \
+    (*(size_t *)((char *)(bp) + DSIZE) = PTR2OFF(newptr))
+#define PUT_NEXT_PTR(bp, newptr)   (*(size_t *)(bp) = PTR2OFF(newptr))
 
 
 /* Global variables */
+static char *heap_base = 0;   /* Start of the heap, links are relative to it */
 static char *heap_listp = 0;  /* Pointer to first block */
 
 /* some other ptrs in the heap, pointint to the start of each free block */
@@ -88,6 +167,10 @@ static char *free_list_head_8192, *free_list_head_max;
 
 
 /* Function prototypes for internal helper routines */
+static void *heap_sbrk(size_t incr);
+static void *alloc_block(size_t size);
+static void free_block(void *bp);
+static void *realloc_block(void *ptr, size_t size);
 static void *extend_heap(size_t words);
 static void *place(void *bp, size_t asize);
 static void *find_fit(size_t asize);
@@ -106,15 +189,21 @@ static void set_list_head(size_t size, void* newptr);
 static void print_each_block(int lineno)
 {
     void *bp = heap_listp;
-    if(GET_SIZE(HDRP(bp)) % 8 != 0)
+    if(GET_SIZE(HDRP(bp)) % ALIGNMENT != 0)
     {
         if(lineno)
-            printf("the prologue not aligns to DSIZE!\n");
+            printf("the prologue not aligns to ALIGNMENT!\n");
         exit(0);
     }
             
     for (; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) 
     {
+        if((size_t)bp % ALIGNMENT != 0)
+        {
+            if(lineno)
+                printf("the payload not aligns to ALIGNMENT!\n");
+            exit(0);
+        }
         if(GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)))
         {
             if(lineno)
@@ -148,7 +237,7 @@ static void print_free_block(int lineno)
         
         cnt *= 2;
         void *bp = free_list_tail;
-        if(!GET_NEXT_PTR(bp))
+        if(NEXT_IS_NULL(bp))
             continue;
         do
         {
@@ -159,7 +248,7 @@ static void print_free_block(int lineno)
                     bp, GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)));
                 printf("next address: %p\n", GET_NEXT_PTR(bp));
             }            
-        }while(GET_NEXT_PTR(bp));
+        }while(!NEXT_IS_NULL(bp));
     }
     
 }
@@ -242,24 +331,311 @@ static void set_list_head(size_t size, void* newptr)
     else free_list_head_max = newptr;
 }
 
+#ifdef MM_PERSIST
+/*
+ * The persistent heap lives in a file mapped with MAP_SHARED. The file
+ * begins with a small header recording the break and whether the heap was
+ * closed cleanly; the heap itself starts right after the header.
+ */
+#define PERSIST_MAGIC    0x4d4d4850UL  /* "MMHP" */
+#define PERSIST_HDRSIZE  64            /* Header size, keeps heap_base aligned */
+#if ALIGNMENT > PERSIST_HDRSIZE
+#error "ALIGNMENT must be no larger than PERSIST_HDRSIZE"
+#endif
+#ifndef PERSIST_MAXHEAP
+#define PERSIST_MAXHEAP  (1UL<<30)     /* Largest heap the file can hold */
+#endif
+/* Define PERSIST_BASE to map the heap at that fixed address only, and to
+ * resume only heaps formatted there. Otherwise it is mapped anywhere. */
+#if defined(PERSIST_BASE) && !defined(MAP_FIXED_NOREPLACE)
+#define MAP_FIXED_NOREPLACE  0         /* Checked by hand after mmap */
+#endif
+
+struct persist_hdr {
+    unsigned long magic;
+    unsigned long brk;    /* Bytes of the heap in use */
+    unsigned long clean;  /* Set by mm_close, cleared while the heap is open */
+    unsigned long align;  /* ALIGNMENT the heap was formatted with */
+    unsigned long base;   /* Address of the heap when it was formatted */
+    unsigned long root;   /* Offset of the application's root, 0 if none */
+};
+
+static int persist_fd = -1;
+static char *persist_map = NULL;
+static struct persist_hdr *persist_hdr = NULL;
+
+/* 
+ * persist_check - Check that the heap in the file is consistent, and
+ * rebuild the list heads, which are the last block of each list.
+ * Return 0 if the heap can be resumed, -1 otherwise.
+ */
+static int persist_check(void)
+{
+    char *heap_end = heap_base + persist_hdr->brk;
+    char *bp, *prev, *tail;
+    size_t size, nfree = 0, nlinked = 0;
+    int i;
+
+    heap_listp = heap_base + ALIGNMENT;
+    if (persist_hdr->align != ALIGNMENT ||
+            persist_hdr->brk < ALIGNMENT + PROLOGUE_SIZE ||
+            persist_hdr->brk > PERSIST_MAXHEAP)
+        return -1;
+    if (GET(HDRP(heap_listp)) != PACK(PROLOGUE_SIZE, 1) ||
+            GET(FTRP(heap_listp)) != PACK(PROLOGUE_SIZE, 1))
+        return -1;
+
+    /* Boundary tags must match, and the epilogue must end at the break */
+    for (bp = NEXT_BLKP(heap_listp); ; bp = NEXT_BLKP(bp))
+    {
+        if (HDRP(bp) + WSIZE > heap_end)
+            return -1;
+        size = GET_SIZE(HDRP(bp));
+        if (size == 0)
+            break;
+        if (size % ALIGNMENT || size < MINBLOCK || bp + size > heap_end)
+            return -1;
+        if (GET(HDRP(bp)) != GET(FTRP(bp)))
+            return -1;
+        if (!GET_ALLOC(HDRP(bp)))
+            nfree++;
+    }
+    if (!GET_ALLOC(HDRP(bp)) || HDRP(bp) + WSIZE != heap_end)
+        return -1;
+
+    /* Every free block must be linked once, into the list of its size */
+    for (i = 0; i < 11; i++)
+    {
+        tail = heap_listp + i * DSIZE;
+        for (prev = tail; (bp = GET_NEXT_PTR(prev)) != NULL; prev = bp)
+        {
+            if (bp < heap_listp + PROLOGUE_SIZE || bp >= heap_end ||
+                    (bp - heap_base) % ALIGNMENT || ++nlinked > nfree)
+                return -1;
+            size = GET_SIZE(HDRP(bp));
+            if (GET_ALLOC(HDRP(bp)) || find_list_tail(size) != tail)
+                return -1;
+            if (size > 16 && GET_PRED_PTR(bp) != prev)
+                return -1;
+        }
+        set_list_head((size_t)16 << i, prev);
+    }
+    return nlinked == nfree ? 0 : -1;
+}
+
+/* 
+ * persist_sync - Write the heap out, then mark it clean. The mapping is
+ * kept, so the heap can still be used. As it is MAP_SHARED, later changes
+ * still reach the file, which says clean all the same: if the process
+ * dies in the middle of one (e.g. in a destructor after persist_atexit),
+ * only persist_check stands between the next mm_init and a corrupt heap.
+ */
+static int persist_sync(void)
+{
+    /* Write the heap out before the clean flag */
+    if (msync(persist_map, PERSIST_HDRSIZE + persist_hdr->brk, MS_SYNC) < 0)
+        return -1;
+    persist_hdr->clean = 1;
+    if (msync(persist_map, PERSIST_HDRSIZE, MS_SYNC) < 0)
+        return -1;
+    return 0;
+}
+
+/* 
+ * persist_atexit - Mark the heap clean at exit. It is not unmapped, as
+ * destructors and other exit handlers may still free into it.
+ */
+static void persist_atexit(void)
+{
+    if (persist_map != NULL)
+        persist_sync();
+}
+
+/* 
+ * persist_unmap - Unmap the heap file without marking it clean. The heap
+ * is not initialized afterwards.
+ */
+static void persist_unmap(void)
+{
+    munmap(persist_map, PERSIST_HDRSIZE + PERSIST_MAXHEAP);
+    close(persist_fd);
+    persist_fd = -1;
+    persist_map = NULL;
+    persist_hdr = NULL;
+    heap_base = heap_listp = 0;
+}
+
+/* 
+ * persist_open - Map the heap file. Return 1 if a cleanly closed heap was
+ * resumed, 0 if the caller has to format a new heap in it, -1 on error,
+ * in which case nothing stays mapped and the heap is not initialized.
+ */
+static int persist_open(const char *path)
+{
+    static int registered = 0;
+    size_t len = PERSIST_HDRSIZE + PERSIST_MAXHEAP;
+    struct stat st;
+    char *map;
+    int fd;
+
+    mm_close();
+    if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+        return -1;
+    /* Only one process may use the heap, e.g. while an old instance is
+     * still shutting down. The lock goes away with the fd. */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    /* The file is sparse, so only the used part of the heap takes space */
+    if (fstat(fd, &st) < 0 ||
+            ((size_t)st.st_size < len && ftruncate(fd, len) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+#ifdef PERSIST_BASE
+    map = mmap((void *)(PERSIST_BASE), len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    /* Older kernels take the address as a hint only */
+    if (map != MAP_FAILED && map != (char *)(PERSIST_BASE))
+    {
+        munmap(map, len);
+        map = MAP_FAILED;
+    }
+#else
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    persist_fd = fd;
+    persist_map = map;
+    persist_hdr = (struct persist_hdr *)map;
+    heap_base = map + PERSIST_HDRSIZE;
+    if (!registered)
+    {
+        atexit(persist_atexit);
+        registered = 1;
+    }
+
+#ifdef PERSIST_BASE
+    /* Raw pointers in the heap are only valid at the address they were
+     * made at */
+    if (persist_hdr->base != (unsigned long)heap_base)
+        persist_hdr->clean = 0;
+#endif
+    if (persist_hdr->magic == PERSIST_MAGIC && persist_hdr->clean &&
+            persist_check() == 0)
+    {
+        /* The flag must be on disk before the heap changes */
+        persist_hdr->clean = 0;
+        if (msync(persist_map, PERSIST_HDRSIZE, MS_SYNC) < 0)
+        {
+            persist_unmap();
+            return -1;
+        }
+        return 1;
+    }
+
+    /* A new file, a crashed process or a corrupt heap: start over */
+    persist_hdr->magic = PERSIST_MAGIC;
+    persist_hdr->brk = 0;
+    persist_hdr->clean = 0;
+    persist_hdr->align = ALIGNMENT;
+    persist_hdr->base = (unsigned long)heap_base;
+    persist_hdr->root = 0;
+    heap_listp = 0;
+    if (msync(persist_map, PERSIST_HDRSIZE, MS_SYNC) < 0)
+    {
+        persist_unmap();
+        return -1;
+    }
+    return 0;
+}
+
+/* 
+ * mm_set_root - Record p, a block of the persistent heap or NULL, as the
+ *               root the application finds its data from after a resume.
+ */
+void mm_set_root(void *p)
+{
+    if (persist_map != NULL)
+        persist_hdr->root = PTR2OFF(p);
+}
+
+/* 
+ * mm_get_root - Return the root set with mm_set_root, or NULL if there is
+ *               none, e.g. because the heap was formatted anew.
+ */
+void *mm_get_root(void)
+{
+    if (persist_map == NULL)
+        return NULL;
+    return OFF2PTR(persist_hdr->root);
+}
+
+/* 
+ * mm_close - Flush the persistent heap, mark it clean so that the next
+ *            mm_init on the same file resumes it, and unmap it. All the
+ *            pointers into the heap are invalid afterwards.
+ */
+int mm_close(void)
+{
+    int ret;
+
+    if (persist_map == NULL)
+        return 0;
+    ret = persist_sync();
+    persist_unmap();
+    return ret;
+}
+#endif /* def MM_PERSIST */
+
 /* 
  * mm_init - Initialize the memory manager
  * There are a header, a footer and 11 ptrs in the prologue block, whose siz
- * is 24 words. The 11 ptrs each points to the first block of the list.
+ * is 24 words rounded up to ALIGNMENT. The 11 ptrs each points to the first
+ * block of the list. The padding before the prologue header makes every
+ * payload aligned to ALIGNMENT.
  */
 int mm_init(void) 
 {
 #ifdef DEBUG
     printf(" ********** init begin! **********\n");
+#endif
+#ifdef MM_PERSIST
+    char *path = getenv("MM_HEAP_FILE");
+    if (path != NULL) {
+        int resumed = persist_open(path);
+        if (resumed < 0)
+            return -1;
+        if (resumed)
+            return 0;   /* The heap in the file is ready to use */
+    }
 #endif
     /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(26*WSIZE)) == (void *)-1) 
+    if ((heap_listp = heap_sbrk(ALIGNMENT + PROLOGUE_SIZE)) == (void *)-1) {
+        heap_listp = 0;   /* Still not initialized */
         return -1;
-    PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE * 12, 1)); /* Prologue header */ 
-    PUT(heap_listp + (24*WSIZE), PACK(DSIZE * 12, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (25*WSIZE), PACK(0, 1));     /* Epilogue header */
-    heap_listp += (2*WSIZE);
+    }
+    /* mem_sbrk may be aligned to less than ALIGNMENT, so skip to the next
+     * boundary, growing the heap by as much */
+    size_t skip = -(size_t)heap_listp & (ALIGNMENT - 1);
+    if (skip != 0 && heap_sbrk(skip) == (void *)-1) {
+        heap_listp = 0;
+        return -1;
+    }
+    heap_listp += skip;
+    heap_base = heap_listp;
+    memset(heap_listp, 0, ALIGNMENT - WSIZE);             /* Alignment padding */
+    heap_listp += ALIGNMENT;
+    PUT(HDRP(heap_listp), PACK(PROLOGUE_SIZE, 1));        /* Prologue header */ 
+    PUT(FTRP(heap_listp), PACK(PROLOGUE_SIZE, 1));        /* Prologue footer */ 
+    PUT(HDRP(NEXT_BLKP(heap_listp)), PACK(0, 1));         /* Epilogue header */
 
     /* the 11 ptrs */
     PUT_NEXT_PTR(heap_listp, NULL); 
@@ -288,16 +664,231 @@ int mm_init(void)
     free_list_head_max = heap_listp + DSIZE * 10;   
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) 
+    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) {
+        heap_listp = 0;
         return -1;
+    }
     
     return 0;
 }
 
+#ifdef MM_TRACE
+/*
+ * Trace recorder. Each thread appends events to its own ring, which only
+ * it writes (head) and only the writer thread or a full ring drains (tail,
+ * under trace_lock). Rings are never freed, so the events of a thread that
+ * has exited are still written out.
+ */
+#ifndef TRACE_RING
+#define TRACE_RING  4096               /* Events per ring, a power of 2 */
+#endif
+#define TRACE_PERIOD_NS  100000000L    /* Writer wakes up at least this often */
+
+struct trace_ring {
+    struct trace_event ev[TRACE_RING];
+    size_t head;                       /* Next event to record */
+    size_t tail;                       /* Next event to write out */
+    unsigned int thread;
+    struct trace_ring *next;           /* All the rings, for the writer */
+};
+
+static int trace_fd = -1;
+static int trace_stop = 0;
+static int trace_running = 0;
+static unsigned int trace_threads = 0;
+static struct trace_ring *trace_rings = NULL;
+static __thread struct trace_ring *trace_self = NULL;
+static pthread_t trace_thread;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+
+#define TRACE(op, in, out, size)  trace_record(op, in, out, size)
+
+/* trace_drain - Write out the events of ring r, with trace_lock held */
+static void trace_drain(struct trace_ring *r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t tail = r->tail;
+    size_t i, n, off;
+    ssize_t done = 1;
+
+    while (tail != head && done > 0)
+    {
+        i = tail % TRACE_RING;
+        n = (head - tail < TRACE_RING - i ? head - tail : TRACE_RING - i)
+            * sizeof(struct trace_event);
+        /* Keep writing after a short write, so no event is cut in two */
+        for (off = 0; off < n; off += done)
+        {
+            done = write(trace_fd, (char *)&r->ev[i] + off, n - off);
+            if (done <= 0)
+                break;   /* Drop the events rather than block the allocator */
+        }
+        tail += n / sizeof(struct trace_event);
+    }
+    __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+}
+
+/* trace_writer - Background thread writing the rings to the trace file */
+static void *trace_writer(void *arg)
+{
+    struct trace_ring *r;
+    struct timespec ts;
+
+    pthread_mutex_lock(&trace_lock);
+    while (!trace_stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += TRACE_PERIOD_NS;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&trace_cond, &trace_lock, &ts);
+        for (r = trace_rings; r != NULL; r = r->next)
+            trace_drain(r);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return arg;
+}
+
+/* trace_ring_new - Set up the ring of the calling thread */
+static struct trace_ring *trace_ring_new(void)
+{
+    /* Not from malloc, which is the function being recorded */
+    struct trace_ring *r = mmap(NULL, sizeof(struct trace_ring),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED)
+        return NULL;
+
+    pthread_mutex_lock(&trace_lock);
+    r->thread = ++trace_threads;
+    r->next = trace_rings;
+    trace_rings = r;
+    pthread_mutex_unlock(&trace_lock);
+    trace_self = r;
+    return r;
+}
+
+/* 
+ * trace_record - Record one event. Blocks are recorded by their offset in
+ * the heap. A full ring is drained by the calling thread itself.
+ */
+static void trace_record(unsigned int op, void *in, void *out, size_t size)
+{
+    struct trace_ring *r = trace_self;
+    struct trace_event *ev;
+    struct timespec ts;
+    size_t head;
+
+    if (trace_fd < 0)
+        return;
+    if (r == NULL && (r = trace_ring_new()) == NULL)
+        return;
+
+    head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == TRACE_RING)
+    {
+        pthread_mutex_lock(&trace_lock);
+        trace_drain(r);
+        pthread_mutex_unlock(&trace_lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ev = &r->ev[head % TRACE_RING];
+    ev->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    ev->size = size;
+    ev->in = PTR2OFF(in);
+    ev->out = PTR2OFF(out);
+    ev->thread = r->thread;
+    ev->op = op;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    /* Wake the writer up early once the ring is half full */
+    if (head + 1 - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) ==
+            TRACE_RING / 2)
+        pthread_cond_signal(&trace_cond);
+}
+
+/* 
+ * mm_trace_flush - Write out everything recorded so far
+ */
+void mm_trace_flush(void)
+{
+    struct trace_ring *r;
+
+    if (trace_fd < 0)
+        return;
+    pthread_mutex_lock(&trace_lock);
+    for (r = trace_rings; r != NULL; r = r->next)
+        trace_drain(r);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+__attribute__((constructor)) static void trace_start(void)
+{
+    const char *path = getenv("MM_TRACE_FILE");
+
+    if (path == NULL)
+        return;
+    if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    trace_running = pthread_create(&trace_thread, NULL, trace_writer, NULL) == 0;
+}
+
+__attribute__((destructor)) static void trace_finish(void)
+{
+    if (trace_fd < 0)
+        return;
+    if (trace_running)
+    {
+        pthread_mutex_lock(&trace_lock);
+        trace_stop = 1;
+        pthread_cond_signal(&trace_cond);
+        pthread_mutex_unlock(&trace_lock);
+        pthread_join(trace_thread, NULL);
+    }
+    mm_trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+}
+#else
+#define TRACE(op, in, out, size)
+#endif /* def MM_TRACE */
+
 /* 
  * malloc - Allocate a block with at least size bytes of payload 
  */
 void *malloc(size_t size) 
+{
+    void *bp = alloc_block(size);
+    TRACE(TRACE_ALLOC, NULL, bp, size);
+    return bp;
+}
+
+/* 
+ * free - Free a block 
+ */
+void free(void *bp)
+{
+    TRACE(TRACE_FREE, bp, NULL, 0);
+    free_block(bp);
+}
+
+/*
+ * realloc - Resize a block, see realloc_block
+ */
+void *realloc(void *ptr, size_t size)
+{
+    void *newptr = realloc_block(ptr, size);
+    TRACE(TRACE_REALLOC, ptr, newptr, size);
+    return newptr;
+}
+
+/* 
+ * alloc_block - Allocate a block with at least size bytes of payload 
+ */
+static void *alloc_block(size_t size) 
 {
 #ifdef DEBUG
     printf(" ********** malloc begin! **********\n");
@@ -311,18 +902,18 @@ void *malloc(size_t size)
     size_t extendsize; /* Amount to extend heap if no fit */
     char *bp;      
 
-    if (heap_listp == 0){
-        mm_init();
+    if (heap_listp == 0 && mm_init() < 0){
+        return NULL;
     }
-    /* Ignore spurious requests */
-    if (size == 0)
+    /* Ignore spurious requests, and ones too big for a block */
+    if (size == 0 || size > MAXBLOCK - DSIZE)
         return NULL;
 
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)                                          
-        asize = 2*DSIZE;                                        
+    if (size <= MINBLOCK - DSIZE)                                          
+        asize = MINBLOCK;                                        
     else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE); 
+        asize = ALIGN(size + DSIZE);
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {  
@@ -340,9 +931,9 @@ void *malloc(size_t size)
 } 
 
 /* 
- * free - Free a block 
+ * free_block - Free a block 
  */
-void free(void *bp)
+static void free_block(void *bp)
 {
 #ifdef DEBUG
     printf("ptr ro free: %p\n", bp);
@@ -356,10 +947,10 @@ void free(void *bp)
     if (bp == 0) 
         return;
 
-    size_t size = GET_SIZE(HDRP(bp));
-    if (heap_listp == 0){
-        mm_init();
+    if (heap_listp == 0 && mm_init() < 0){
+        return;
     }
+    size_t size = GET_SIZE(HDRP(bp));
 
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
@@ -368,14 +959,14 @@ void free(void *bp)
 }
 
 /*
- * realloc - Naive implementation of realloc
+ * realloc_block - Naive implementation of realloc
  * Firstly, we check if the old block is big enough.
  * If so, we directly allocate its space to the new block.
  * Otherwise, we check if the next block is empty.
  * If so, we coalesce these blocks and repeat the steps.
  * Otherwise, we malloc a new space.
  */
-void *realloc(void *ptr, size_t size)
+static void *realloc_block(void *ptr, size_t size)
 {
 #ifdef DEBUG
     printf(" ********** realloc begin! **********\n");
@@ -386,31 +977,35 @@ void *realloc(void *ptr, size_t size)
 
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
-        mm_free(ptr);
+        free_block(ptr);
         return 0;
     }
 
     /* If oldptr is NULL, then this is just malloc. */
     if(ptr == NULL) {
-        return mm_malloc(size);
+        return alloc_block(size);
     }
 
+    /* Too big for a block, leave the old one untouched */
+    if(size > MAXBLOCK - DSIZE)
+        return 0;
+
     /* Copy the old data. */
     oldsize = GET_SIZE(HDRP(ptr));
     size_t asize;
-    if (size <= DSIZE)                                          
-        asize = 2*DSIZE;                                        
+    if (size <= MINBLOCK - DSIZE)                                          
+        asize = MINBLOCK;                                        
     else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+        asize = ALIGN(size + DSIZE);
 
     /* the old block can be separated to a new block and a new free block. */
-    if(oldsize >= asize + 2 * DSIZE) 
+    if(oldsize >= asize + MINBLOCK) 
     {
         PUT(HDRP(ptr), PACK(asize, 1));
         PUT(FTRP(ptr), PACK(asize, 1));
         PUT(HDRP(NEXT_BLKP(ptr)), PACK(oldsize - asize, 1));
         PUT(FTRP(NEXT_BLKP(ptr)), PACK(oldsize - asize, 1));
-        free(NEXT_BLKP(ptr));
+        free_block(NEXT_BLKP(ptr));
         return ptr;
     }
 
@@ -427,7 +1022,7 @@ void *realloc(void *ptr, size_t size)
         size_t nowsize = oldsize + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
         /* After coalescing, the new block is big enough to contain
            a free block and an allocated block */
-        if(nowsize >= asize + 2 * DSIZE) 
+        if(nowsize >= asize + MINBLOCK) 
         {
             remove_frome_free_list(NEXT_BLKP(ptr));
             PUT(HDRP(ptr), PACK(asize, 1));
@@ -446,7 +1041,7 @@ void *realloc(void *ptr, size_t size)
         }
     }
 
-    newptr = mm_malloc(asize);
+    newptr = alloc_block(asize);
 
     /* If realloc() fails the original block is left untouched  */
     if(!newptr) {
@@ -455,7 +1050,7 @@ void *realloc(void *ptr, size_t size)
     memcpy(newptr, ptr, oldsize);
 
     /* Free the old block. */
-    mm_free(ptr);
+    free_block(ptr);
 
     return newptr;
 }
@@ -468,12 +1063,178 @@ void *calloc (size_t nmemb, size_t size)
     size_t bytes = nmemb * size;
     void *newptr;
 
-    newptr = malloc(bytes);
+    /* nmemb * size overflowed */
+    if (size != 0 && bytes / size != nmemb)
+        return NULL;
+    if ((newptr = alloc_block(bytes)) == NULL)
+        return NULL;
     memset(newptr, 0, bytes);
+    TRACE(TRACE_ALLOC, NULL, newptr, bytes);
 
     return newptr;
 }
 
+/* 
+ * mm_memalign - Allocate a block whose payload is aligned to alignment,
+ *               a power of 2. For a larger alignment than ALIGNMENT, we
+ *               allocate enough to find an aligned payload with room for
+ *               a free block before it, then free the space before and
+ *               after it.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    char *bp, *ap;
+    size_t bsize, front;
+
+    if (size == 0 || size > MAXBLOCK - DSIZE)
+        return NULL;
+    if (alignment <= ALIGNMENT)
+        return malloc(size);
+    if ((alignment & (alignment - 1)) || alignment > MAXBLOCK / 2 ||
+            size > MAXBLOCK - DSIZE - alignment - MINBLOCK)
+        return NULL;
+    if ((bp = alloc_block(size + alignment + MINBLOCK)) == NULL)
+        return NULL;
+
+    if ((size_t)bp % alignment == 0)
+        ap = bp;
+    else
+    {
+        /* The front is a multiple of ALIGNMENT and at least MINBLOCK */
+        ap = (char *)(((size_t)bp + MINBLOCK + alignment - 1) &
+            ~(alignment - 1));
+        bsize = GET_SIZE(HDRP(bp));
+        front = ap - bp;
+        PUT(HDRP(bp), PACK(front, 1));
+        PUT(FTRP(bp), PACK(front, 1));
+        PUT(HDRP(ap), PACK(bsize - front, 1));
+        PUT(FTRP(ap), PACK(bsize - front, 1));
+        free_block(bp);
+    }
+    /* Shrinking in place splits off the space after the payload */
+    realloc_block(ap, size);
+    TRACE(TRACE_ALLOC, NULL, ap, size);
+    return ap;
+}
+
+/* 
+ * mm_free_sized - Free a block of at least size bytes, 0 if unknown.
+ * The size in the header is still the one used: a block can be larger
+ * than the request (a remainder too small to split, or growth in place
+ * by realloc), and the header is next to the footer of the previous
+ * block, which coalesce reads anyway. DEBUG builds check the size.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+#ifdef DEBUG
+    if (ptr != NULL && GET_SIZE(HDRP(ptr)) - DSIZE < size)
+        printf("free size %zx is larger than the block\n", size);
+#endif
+    (void)size;
+    free(ptr);
+}
+
+/* 
+ * mm_reserve - Grow the heap by at least bytes in one step, as a single
+ *              free block. Return 0 on success, -1 on error, including
+ *              when bytes is more than a block can hold.
+ */
+int mm_reserve(size_t bytes)
+{
+    if (heap_listp == 0 && mm_init() < 0)
+        return -1;
+    if (bytes == 0)
+        return 0;
+    if (bytes > MAXBLOCK)
+        return -1;
+    return extend_heap(ALIGN(bytes)/WSIZE) == NULL ? -1 : 0;
+}
+
+/* 
+ * prewarm_size - Block size mm_prewarm makes for a profiled size
+ */
+static size_t prewarm_size(size_t size)
+{
+    return ALIGN(MAX(size, MINBLOCK));
+}
+
+/* 
+ * mm_prewarm - Grow the heap in one step and split it into free blocks of
+ *              the n given block sizes, as recorded by mm_profile, so the
+ *              same requests later take them without splitting.
+ * The new blocks are left next to each other without coalescing, they are
+ * coalesced as usual when their neighbours are freed.
+ * Return 0 on success, -1 on error.
+ */
+int mm_prewarm(const size_t sizes[], size_t n)
+{
+    size_t total = 0, left, size, i;
+    char *bp;
+
+    if (heap_listp == 0 && mm_init() < 0)
+        return -1;
+    for (i = 0; i < n; i++)
+    {
+        /* The blocks are split from one block, which has to fit in the
+         * header too */
+        if (sizes[i] > MAXBLOCK)
+            return -1;
+        size = prewarm_size(sizes[i]);
+        if (size > MAXBLOCK - total)
+            return -1;
+        total += size;
+    }
+    if (total == 0)
+        return 0;
+    if ((bp = extend_heap(total/WSIZE)) == NULL)
+        return -1;
+
+    /* bp may start earlier than the new memory, if it was coalesced with
+     * a free block before it. The rest after the split stays one block. */
+    left = GET_SIZE(HDRP(bp));
+    remove_frome_free_list(bp);
+    for (i = 0; i < n; i++)
+    {
+        size = prewarm_size(sizes[i]);
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+        add_to_free_list(bp);
+        bp = NEXT_BLKP(bp);
+        left -= size;
+    }
+    if (left > 0)
+    {
+        PUT(HDRP(bp), PACK(left, 0));
+        PUT(FTRP(bp), PACK(left, 0));
+        add_to_free_list(bp);
+    }
+    return 0;
+}
+
+/* 
+ * mm_profile - Store the sizes of up to n allocated blocks in sizes, as a
+ *              profile for mm_prewarm in a later run. Return the number of
+ *              allocated blocks, which may be more than n.
+ */
+size_t mm_profile(size_t sizes[], size_t n)
+{
+    size_t count = 0;
+    char *bp;
+
+    if (heap_listp == 0)
+        return 0;
+    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    {
+        if (GET_ALLOC(HDRP(bp)))
+        {
+            if (count < n)
+                sizes[count] = GET_SIZE(HDRP(bp));
+            count++;
+        }
+    }
+    return count;
+}
+
 /* 
  * mm_checkheap - Check the heap for correctness. Helpful hint: You
  *                can call this function using mm_checkheap(__LINE__);
@@ -490,6 +1251,27 @@ void mm_checkheap(int lineno)
  * The remaining routines are internal helper routines 
  */
 
+/* 
+ * heap_sbrk - Grow the heap by incr bytes, from the heap file if one is
+ *             mapped, or from mem_sbrk otherwise. Return the old break.
+ */
+static void *heap_sbrk(size_t incr)
+{
+#ifdef MM_PERSIST
+    if (persist_map != NULL) {
+        char *old_brk = heap_base + persist_hdr->brk;
+        if (incr > PERSIST_MAXHEAP - persist_hdr->brk)
+            return (void *)-1;
+        persist_hdr->brk += incr;
+        return old_brk;
+    }
+#endif
+    /* mem_sbrk takes an int */
+    if (incr > INT_MAX)
+        return (void *)-1;
+    return mem_sbrk(incr);
+}
+
 /* 
  * extend_heap - Extend heap with free block and return its block pointer
  */
@@ -501,9 +1283,9 @@ static void *extend_heap(size_t words)
     char *bp;
     size_t size;
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-    if ((long)(bp = mem_sbrk(size)) == -1)  
+    /* Allocate a multiple of ALIGNMENT to maintain alignment */
+    size = ALIGN(words * WSIZE); 
+    if ((long)(bp = heap_sbrk(size)) == -1)  
         return NULL;                                        
 
     /* Initialize free block header/footer and the epilogue header */
@@ -538,7 +1320,7 @@ static void remove_frome_free_list(void* bp)
     if(GET_SIZE(HDRP(bp)) > 16)
     {
         /* we want to remove the head of this list */
-        if(GET_NEXT_PTR(bp) == NULL)
+        if(NEXT_IS_NULL(bp))
         {
             set_list_head(GET_SIZE(HDRP(bp)), GET_PRED_PTR(bp));
             PUT_NEXT_PTR(find_list_head(GET_SIZE(HDRP(bp))), NULL);
@@ -557,7 +1339,7 @@ static void remove_frome_free_list(void* bp)
         for(bp_pred = free_list_tail; GET_NEXT_PTR(bp_pred) != bp; bp_pred = GET_NEXT_PTR(bp_pred));
 
         /* we want to remove the head of this list */
-        if(GET_NEXT_PTR(bp) == NULL)
+        if(NEXT_IS_NULL(bp))
         {
             set_list_head(GET_SIZE(HDRP(bp)), bp_pred);
             PUT_NEXT_PTR(find_list_head(GET_SIZE(HDRP(bp))), NULL);
@@ -689,7 +1471,7 @@ static void* place(void *bp, size_t asize)
     size_t csize = GET_SIZE(HDRP(bp));
 //    printf("csize-asize: %x\n", csize-asize);
 
-    if ((csize - asize) >= (2*DSIZE)) { 
+    if ((csize - asize) >= MINBLOCK) { 
         remove_frome_free_list(bp);
         PUT(HDRP(bp), PACK(csize-asize, 0));
         PUT(FTRP(bp), PACK(csize-asize, 0));
@@ -0,0 +1,41 @@
+/* 
+ * Entry points of malloclab_mm.c beyond the malloc, free, realloc and
+ * calloc interface of mm.h. The persistent heap and trace functions
+ * only exist when malloclab_mm.c is compiled with MM_PERSIST or MM_TRACE,
+ * so compile callers with the same flags.
+ */
+#ifndef MALLOCLAB_MM_H
+#define MALLOCLAB_MM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Startup: grow the heap in one step, and pre-split it from a profile */
+int mm_reserve(size_t bytes);
+int mm_prewarm(const size_t sizes[], size_t n);
+size_t mm_profile(size_t sizes[], size_t n);
+
+/* Aligned allocation and free with a known size, for C++ */
+void *mm_memalign(size_t alignment, size_t size);
+void mm_free_sized(void *ptr, size_t size);
+
+#ifdef MM_PERSIST
+/* Persistent heap: pointers into the heap are invalid after mm_close */
+int mm_close(void);
+void mm_set_root(void *p);
+void *mm_get_root(void);
+#endif
+
+#ifdef MM_TRACE
+/* Write out the trace events recorded so far */
+void mm_trace_flush(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MALLOCLAB_MM_H */
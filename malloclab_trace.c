@@ -0,0 +1,231 @@
+/*
+ * Convert a binary allocation trace (see malloclab_trace.h) into the
+ * malloclab trace format, so that it can be replayed by the driver:
+ *
+ *     gcc -O2 -o malloclab_trace malloclab_trace.c
+ *     ./malloclab_trace mm_trace.bin > capture.rep
+ *
+ * The events are sorted by time, and each block gets a new id when it is
+ * allocated, which follows it through realloc until it is freed. Blocks
+ * allocated before the recording started are not in the trace, so frees
+ * of them are skipped, and a realloc of one starts a new id. Failed
+ * requests are skipped too.
+ * The suggested heap size is the peak of the live requested bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "malloclab_trace.h"
+
+/* An event and its position in the file, to keep the sort stable */
+struct entry {
+    struct trace_event ev;
+    size_t seq;
+};
+
+/* An operation of the output trace */
+struct op {
+    char type;
+    int id;
+    size_t size;
+};
+
+/* Map from the offset of a live block to its id, with linear probing */
+static uint32_t *map_key;   /* 0 marks an empty slot */
+static int *map_id;
+static size_t map_cap, map_used;
+
+static size_t map_slot(uint32_t key)
+{
+    size_t i = (key * 2654435761u) & (map_cap - 1);
+    while (map_key[i] != 0 && map_key[i] != key)
+        i = (i + 1) & (map_cap - 1);
+    return i;
+}
+
+static int map_get(uint32_t key)
+{
+    size_t i = map_slot(key);
+    return map_key[i] ? map_id[i] : -1;
+}
+
+static void map_put(uint32_t key, int id)
+{
+    size_t i;
+
+    if (2 * (map_used + 1) > map_cap)
+    {
+        uint32_t *old_key = map_key;
+        int *old_id = map_id;
+        size_t old_cap = map_cap;
+
+        map_cap = map_cap ? 2 * map_cap : 1024;
+        map_key = calloc(map_cap, sizeof(uint32_t));
+        map_id = malloc(map_cap * sizeof(int));
+        if (map_key == NULL || map_id == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < old_cap; i++)
+            if (old_key[i] != 0)
+            {
+                size_t j = map_slot(old_key[i]);
+                map_key[j] = old_key[i];
+                map_id[j] = old_id[i];
+            }
+        free(old_key);
+        free(old_id);
+    }
+    i = map_slot(key);
+    if (map_key[i] == 0)
+        map_used++;
+    map_key[i] = key;
+    map_id[i] = id;
+}
+
+static void map_remove(uint32_t key)
+{
+    size_t i = map_slot(key), j, home;
+
+    if (map_key[i] == 0)
+        return;
+    map_used--;
+    /* Shift the following entries back so no probe chain is broken */
+    for (j = (i + 1) & (map_cap - 1); map_key[j] != 0;
+            j = (j + 1) & (map_cap - 1))
+    {
+        home = (map_key[j] * 2654435761u) & (map_cap - 1);
+        if (((j - home) & (map_cap - 1)) >= ((j - i) & (map_cap - 1)))
+        {
+            map_key[i] = map_key[j];
+            map_id[i] = map_id[j];
+            i = j;
+        }
+    }
+    map_key[i] = 0;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    const struct entry *x = a, *y = b;
+
+    if (x->ev.time != y->ev.time)
+        return x->ev.time < y->ev.time ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    struct entry *ent = NULL;
+    struct op *ops;
+    size_t *live = NULL;        /* Size of each id, 0 once freed */
+    size_t nent = 0, cap = 0, nops = 0, nids = 0, live_cap = 0;
+    size_t bytes = 0, peak = 0, i;
+    struct trace_event ev;
+    int id;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s tracefile > file.rep\n", argv[0]);
+        return 1;
+    }
+    if ((fp = fopen(argv[1], "rb")) == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    while (fread(&ev, sizeof(ev), 1, fp) == 1)
+    {
+        if (nent == cap)
+        {
+            cap = cap ? 2 * cap : 4096;
+            if ((ent = realloc(ent, cap * sizeof(struct entry))) == NULL)
+            {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+        }
+        ent[nent].ev = ev;
+        ent[nent].seq = nent;
+        nent++;
+    }
+    fclose(fp);
+    qsort(ent, nent, sizeof(struct entry), cmp_entry);
+
+    /* Each event makes at most one operation */
+    if ((ops = malloc((nent ? nent : 1) * sizeof(struct op))) == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < nent; i++)
+    {
+        ev = ent[i].ev;
+        id = ev.in ? map_get(ev.in) : -1;
+
+        /* realloc(NULL, size) is malloc, and realloc(p, 0) is free */
+        if (ev.op == TRACE_REALLOC && id < 0 && ev.size != 0)
+            ev.op = TRACE_ALLOC;
+        else if (ev.op == TRACE_REALLOC && ev.size == 0)
+            ev.op = TRACE_FREE;
+
+        if (ev.op == TRACE_ALLOC)
+        {
+            if (ev.out == 0)
+                continue;
+            if (nids == live_cap)
+            {
+                live_cap = live_cap ? 2 * live_cap : 4096;
+                if ((live = realloc(live, live_cap * sizeof(size_t))) == NULL)
+                {
+                    fprintf(stderr, "out of memory\n");
+                    return 1;
+                }
+            }
+            id = nids++;
+            live[id] = ev.size;
+            bytes += ev.size;
+            map_put(ev.out, id);
+            ops[nops].type = 'a';
+        }
+        else if (ev.op == TRACE_FREE)
+        {
+            if (id < 0)
+                continue;
+            bytes -= live[id];
+            live[id] = 0;
+            map_remove(ev.in);
+            ops[nops].type = 'f';
+        }
+        else if (ev.op == TRACE_REALLOC)
+        {
+            if (ev.out == 0)
+                continue;   /* Failed, the old block is left untouched */
+            bytes += ev.size - live[id];
+            live[id] = ev.size;
+            map_remove(ev.in);
+            map_put(ev.out, id);
+            ops[nops].type = 'r';
+        }
+        else
+            continue;
+        ops[nops].id = id;
+        ops[nops].size = ev.size;
+        nops++;
+        if (bytes > peak)
+            peak = bytes;
+    }
+
+    printf("%zu\n%zu\n%zu\n1\n", peak, nids, nops);
+    for (i = 0; i < nops; i++)
+    {
+        if (ops[i].type == 'f')
+            printf("f %d\n", ops[i].id);
+        else
+            printf("%c %d %zu\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    return 0;
+}
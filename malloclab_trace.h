@@ -0,0 +1,30 @@
+/* 
+ * Binary allocation trace, written by malloclab_mm.c when it is compiled
+ * with -DMM_TRACE, and read by the converter in malloclab_trace.c.
+ * 
+ * The file is a sequence of fixed-size events in the byte order of the
+ * machine that recorded them. Events of one thread are in order, but the
+ * threads are written out in chunks, so readers sort by time.
+ * Blocks are identified by their offset from the start of the heap, and
+ * offset 0 stands for NULL.
+ */
+#ifndef MALLOCLAB_TRACE_H
+#define MALLOCLAB_TRACE_H
+
+#include <stdint.h>
+
+/* Operations */
+#define TRACE_ALLOC    1   /* malloc or calloc: out, size */
+#define TRACE_FREE     2   /* free: in */
+#define TRACE_REALLOC  3   /* realloc: in, out, size */
+
+struct trace_event {
+    uint64_t time;     /* CLOCK_MONOTONIC, in nanoseconds */
+    uint64_t size;     /* Requested size (bytes) */
+    uint32_t in;       /* Block passed in */
+    uint32_t out;      /* Block returned */
+    uint32_t thread;   /* Recording thread, numbered from 1 */
+    uint32_t op;       /* One of the operations above */
+};
+
+#endif /* MALLOCLAB_TRACE_H */